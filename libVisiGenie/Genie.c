@@ -4,6 +4,7 @@
 #include "fdserial.h"
 #include "mstimer.h"
 #include "simpletext.h"
+#include "simpletools.h"
 #include "Genie.h"
 
 /////////////////////////// GenieArduino 27/09/2013 /////////////////////////
@@ -50,12 +51,37 @@ void    _handleError          (void);
 void    _geniePutchar         (int c);
 int     _genieGetchar         (void);
 void    _genieSetLinkState    (int newstate);
+void    _geniePushLinkState   (int newstate);
+void    _geniePopLinkState    (void);
+void    _genieInsertLinkState (int newstate);
+void    _genieRemoveLinkState (int state);
+void    _genieResetLink       (void);
 int     _genieGetLinkState    (void);
 bool    _genieEnqueueEvent    (int * data);
-
+void    _genieBroadcastEvent  (int * data);
+void    _genieSnapshotObj     (int object, int index, int data);
+void    _genieSnapshotStr     (int index, char *string);
+static void _genieTxRead      (int object, int index);
+static int  _genieDoEvent     (void);
+void    _genieTxAcked         (bool ack);
+void    _genieTxTimeout       (void);
+void    _genieRttSample       (int cmd, int rtt);
+void    _genieLockLink        (void);
+void    _genieUnlockLink      (void);
+
+#ifdef GENIE_COG_DRIVER
+// Mailbox shared with the cog driver, see GenieFrame.h
+static genieCogMailbox _genieCog;
+extern unsigned int _load_start_genie_uart_cog[];
+#else
 // Display Serial Terminal
 static fdserial *term;
 
+// Frame assembler for genieDoEvents(), and the frame it fills
+static genieFramerStruct _genieFramer;
+static int _genieRxFrame[GENIE_FRAME_SIZE];
+#endif
+
 // cog stack
 unsigned int stack[(160 + (50 * 4)) / 4];
 static int cog;
@@ -66,6 +92,16 @@ static int cog;
 //
 static genieEventQueueStruct _genieEventQueue;
 
+//////////////////////////////////////////////////////////////
+// The event broadcast ring. _genieBroadcastSeq counts every event
+// ever written, the ring holds the last MAX_GENIE_BROADCAST of 
+// them. It is only written by genieDoEvents(), subscribers only
+// ever read it.
+//
+static volatile genieFrame _genieBroadcast[MAX_GENIE_BROADCAST];
+static volatile unsigned int _genieBroadcastSeq = 0;
+static genieSubscriberStruct _genieSubscribers[MAX_GENIE_SUBSCRIBERS];
+
 //////////////////////////////////////////////////////////////
 // Simple 5-deep stack for the link state, this allows 
 // genieDoEvents() to save the current state, receive a frame,
@@ -90,12 +126,56 @@ static int _genieTimeouts = 0;
 // Global error variable
 static int _genieError = ERROR_NONE;
 
-static int rxframe_count = 0;
-
 //////////////////////////////////////////////////////////////
 // Number of fatal errors encountered
 static int _genieFatalErrors = 0;
 
+//////////////////////////////////////////////////////////////
+// Commands sent but not yet ACKed, oldest first, so that each
+// ACK or NAK can be matched to the command that caused it
+//
+static int  _genieTxCmd[GENIE_MAX_WINDOW];
+static int  _genieTxEntry[GENIE_MAX_WINDOW];
+static long _genieTxTime[GENIE_MAX_WINDOW];
+static int  _genieTxHead = 0;
+static int  _genieTxCount = 0;
+static long _genieLastTx = 0;
+
+//////////////////////////////////////////////////////////////
+// After a timeout nothing is sent until this time, so a late ACK
+// for a forgotten command arrives while the link is idle and is 
+// discarded instead of retiring the next command
+static long _genieTxHoldUntil = 0;
+
+//////////////////////////////////////////////////////////////
+// Hardware lock taken by whichever cog is changing the link 
+// state, the outstanding command FIFO or the window, see 
+// _genieLockLink()
+static int _genieLock = -1;
+
+//////////////////////////////////////////////////////////////
+// Time the last GENIE_READ_OBJ was sent
+static long _genieReadTime = 0;
+
+//////////////////////////////////////////////////////////////
+// TRUE while genieWaitReady() is probing, its report frames are
+// not queued for the user
+static bool _genieProbing = FALSE;
+
+//////////////////////////////////////////////////////////////
+// Round trip times and window size, see genieGetStats()
+static genieStatsStruct _genieStats;
+
+//////////////////////////////////////////////////////////////
+// Last values written to the display, see genieSnapshotRestore()
+static genieSnapshotStruct _genieSnapshot = {GENIE_SNAPSHOT_MAGIC, -1, -1};
+
+//////////////////////////////////////////////////////////////
+// Writes queued by the genieBatch...() functions
+//
+static genieBatchEntry _genieBatch[MAX_GENIE_BATCH];
+static int  _genieBatchCount = 0;
+
 //////////////////////////////////////////////////////////////
 // Pointer to the user's event handler function
 //
@@ -130,6 +210,29 @@ bool genieEventIs (genieFrame * e, int cmd, int object, int index)
     e->reportObject.index == index);
 }
 
+///////////////////////// _genieLockLink /////////////////////////
+//
+// genieDoEvents() runs on the monitor cog and on any cog waiting
+// to send, so the link state, the outstanding command FIFO and 
+// the window are only changed while holding _genieLock. The lock
+// is not recursive.
+//
+void _genieLockLink (void) 
+{
+  if (_genieLock >= 0) {
+    while (lockset(_genieLock)) ;
+  }
+}
+
+//////////////////////// _genieUnlockLink /////////////////////////
+//
+void _genieUnlockLink (void) 
+{
+  if (_genieLock >= 0) {
+    lockclr(_genieLock);
+  }
+}
+
 ////////////////////// _genieWaitForIdle ////////////////////////
 //
 // Wait for the link to become idle or for the timeout period, 
@@ -151,13 +254,179 @@ void _genieWaitForIdle (void)
       timeout = mstime_get() + _genieTimeout;
     }
     
-    if (_genieGetLinkState() == GENIE_LINK_IDLE) {
+    if (_genieGetLinkState() == GENIE_LINK_IDLE && 
+      mstime_get() >= _genieTxHoldUntil) {
+      return;
+    }
+  }
+  _genieTxTimeout();
+  return;
+}
+
+////////////////////// _genieWaitForSlot ////////////////////////
+//
+// Wait until another command may be sent. That is when the link
+// is idle, or when it is waiting for ACKs with fewer than the
+// current window of commands outstanding and at least the paced
+// gap (round trip time / window) since the last command.
+//
+// Parms:  int cmd, the command about to be sent
+//
+void _genieWaitForSlot (int cmd) 
+{
+  int state;
+  long timeout = mstime_get() + _genieTimeout;
+
+  for (; mstime_get() < timeout;) {
+    if (genieDoEvents() == GENIE_EVENT_RXCHAR) {
+      timeout = mstime_get() + _genieTimeout;
+    }
+
+    if (mstime_get() < _genieTxHoldUntil) {
+      continue;
+    }
+
+    state = _genieGetLinkState();
+    if (state == GENIE_LINK_IDLE) {
+      return;
+    }
+    if (state == GENIE_LINK_WFAN && 
+      _genieTxCount < (_genieStats.window >> 3) &&
+      mstime_get() - _genieLastTx >= _genieStats.cmd[cmd].srtt / _genieStats.window) {
       return;
     }
   }
+  _genieTxTimeout();
+}
+
+////////////////////////// _genieTxSent ///////////////////////////
+//
+// Record a command that has just been sent and now waits for an 
+// ACK. The link enters GENIE_LINK_WFAN with the first of them, 
+// beneath any frame genieDoEvents() is part way through receiving.
+//
+// Parms:  int cmd, the command sent
+//      int entry, the genieBatchCommit() entry it writes, whose
+//        result its reply sets, or -1
+//
+void _genieTxSent (int cmd, int entry) 
+{
+  int slot;
+
+  _genieLockLink();
+
+  slot = (_genieTxHead + _genieTxCount) & (GENIE_MAX_WINDOW -1);
+  _genieTxCmd[slot] = cmd;
+  _genieTxEntry[slot] = entry;
+  _genieTxTime[slot] = _genieLastTx = mstime_get();
+
+  if (_genieTxCount++ == 0) {
+    _genieInsertLinkState(GENIE_LINK_WFAN);
+  }
+
+  _genieUnlockLink();
+}
+
+////////////////////////// _genieTxAcked //////////////////////////
+//
+// Retire the oldest outstanding command. An ACK samples its round
+// trip time and opens the window a little, a NAK halves it.
+// Called from genieDoEvents() with _genieLock held.
+//
+// Parms:  bool ack, TRUE for an ACK, FALSE for a NAK
+//
+void _genieTxAcked (bool ack) 
+{
+  int cmd;
+  int rtt;
+
+  if (_genieTxCount == 0) {
+    return;
+  }
+
+  cmd = _genieTxCmd[_genieTxHead];
+  rtt = mstime_get() - _genieTxTime[_genieTxHead];
+  if (_genieTxEntry[_genieTxHead] >= 0) {
+    _genieBatch[_genieTxEntry[_genieTxHead]].result = ack ? ERROR_NONE : ERROR_NAK;
+  }
+  _genieTxHead = (_genieTxHead + 1) & (GENIE_MAX_WINDOW -1);
+
+  if (--_genieTxCount == 0) {
+    _genieRemoveLinkState(GENIE_LINK_WFAN);
+  }
+
+  if (ack) {
+    _genieRttSample(cmd, rtt);
+    _genieStats.window += 64 / _genieStats.window;
+    if (_genieStats.window > GENIE_MAX_WINDOW << 3) {
+      _genieStats.window = GENIE_MAX_WINDOW << 3;
+    }
+  } else {
+    _genieStats.cmd[cmd].naks++;
+    _genieStats.window >>= 1;
+    if (_genieStats.window < 8) {
+      _genieStats.window = 8;
+    }
+  }
+}
+
+///////////////////////// _genieTxTimeout /////////////////////////
+//
+// The display has stopped answering. Forget the outstanding
+// commands, fall back to one command at a time and hold off 
+// sending for RESYNC_PERIOD in case their ACKs are only late.
+// GENIE_LINK_WFAN is removed wherever it is in the stack, the
+// monitor cog may be part way through an event frame above it.
+//
+void _genieTxTimeout (void) 
+{
+  _genieLockLink();
+
+  if (_genieTxCount > 0) {
+    _genieRemoveLinkState(GENIE_LINK_WFAN);
+  }
+  _genieTxCount = 0;
+  _genieStats.window = 8;
+  _genieTimeouts++;
+  _genieTxHoldUntil = mstime_get() + RESYNC_PERIOD;
+
+  _genieUnlockLink();
+
   _genieError = ERROR_TIMEOUT;
   _handleError();
-  return;
+}
+
+///////////////////////// _genieRttSample /////////////////////////
+//
+// Fold a measured round trip time into the smoothed values for a
+// command type, the same way TCP does (gains of 1/8 and 1/4).
+//
+void _genieRttSample (int cmd, int rtt) 
+{
+  int err;
+  genieCmdStatsStruct *s = &_genieStats.cmd[cmd];
+
+  if (s->replies++ == 0) {
+    s->srtt   = rtt << 3;
+    s->rttvar = rtt << 1;
+    return;
+  }
+
+  err = rtt - (s->srtt >> 3);
+  s->srtt += err;
+  if (err < 0) err = -err;
+  s->rttvar += err - (s->rttvar >> 2);
+}
+
+////////////////////////// genieGetStats //////////////////////////
+//
+// Copy the rate control statistics to a buffer supplied by the 
+// caller.
+//
+void genieGetStats (genieStatsStruct * stats) 
+{
+  _genieStats.timeouts = _genieTimeouts;
+  *stats = _genieStats;
 }
 
 ////////////////////// _geniePushLinkState //////////////////////
@@ -182,25 +451,153 @@ void _geniePopLinkState (void)
   }
 }
 
+///////////////////// _genieInsertLinkState /////////////////////
+//
+// Push a link state beneath any frame being received, so that
+// when the frame is complete its pop reveals the new state.
+//
+void _genieInsertLinkState (int newstate) 
+{
+  int *p;
+
+  if (_genieLinkState == &_genieLinkStates[4]) {
+    return;  // stack full
+  }
+  _genieLinkState++;
+  for (p = _genieLinkState; p > &_genieLinkStates[1] && 
+    (p[-1] == GENIE_LINK_RXREPORT || p[-1] == GENIE_LINK_RXEVENT); p--) {
+    *p = p[-1];
+  }
+  *p = newstate;
+}
+
+///////////////////// _genieRemoveLinkState /////////////////////
+//
+// Remove the topmost entry holding a state from anywhere in the
+// stack, the states above it move down one place. The bottom 
+// entry is never removed.
+//
+void _genieRemoveLinkState (int state) 
+{
+  int *p;
+
+  for (p = _genieLinkState; p > &_genieLinkStates[0]; p--) {
+    if (*p == state) {
+      for (; p < _genieLinkState; p++) {
+        *p = p[1];
+      }
+      *_genieLinkState = 0xFF;
+      _genieLinkState--;
+      return;
+    }
+  }
+}
+
+///////////////////////// _genieResetLink //////////////////////////
+//
+// Return the link to idle with nothing outstanding and no hold 
+// off, after the display has been reset or resynchronised.
+//
+void _genieResetLink (void) 
+{
+  _genieLockLink();
+  _genieLinkState = &_genieLinkStates[0];
+  _genieSetLinkState(GENIE_LINK_IDLE);
+  _genieTxCount = 0;
+  _genieTxHoldUntil = 0;
+  _genieUnlockLink();
+}
+
 ///////////////////////// genieDoEvents /////////////////////////
 //
-// This is the heart of the Genie comms state machine.
+// Process one received character with _genieLock held, so the
+// monitor cog and a cog waiting to send never interleave.
 //
 int genieDoEvents (void) 
 {
-  int c;
-  static int  rx_data[6];
-  static int  checksum = 0;
+  int result;
 
-  c = _genieGetchar();
+  _genieLockLink();
+  result = _genieDoEvent();
+  _genieUnlockLink();
 
   ////////////////////////////////////////////
   //
   // If there are no characters to process and we have 
   // queued events call the user's handler function.
   //
-  if (_genieError == ERROR_NOCHAR) {
+  if (result == GENIE_EVENT_NONE) {
     if (_genieEventQueue.n_events > 0 && _genieUserHandler!= NULL) (_genieUserHandler)();
+  }
+  return result;
+}
+
+#ifdef GENIE_COG_DRIVER
+///////////////////////// _genieDoEvent /////////////////////////
+//
+// Take one entry from the cog driver. It has already assembled 
+// and checked the frames and dropped stray characters, so only 
+// the link state is left to handle here.
+//
+static int _genieDoEvent (void) 
+{
+  volatile int *entry;
+  int frame[GENIE_FRAME_SIZE];
+
+  _genieError = ERROR_NONE;
+
+  if (_genieCog.rx_tail == _genieCog.rx_head) {
+    _genieError = ERROR_NOCHAR;
+    return GENIE_EVENT_NONE;
+  }
+
+  entry = _genieCog.rx_buf[_genieCog.rx_tail];
+  for (int j = 0; j < GENIE_FRAME_SIZE; j++) {
+    frame[j] = entry[j];
+  }
+  _genieCog.rx_tail = (_genieCog.rx_tail + 1) & (GENIE_COG_RXBUF -1);
+
+  switch (frame[0]) {
+    case GENIE_ACK:
+    case GENIE_NAK:
+      if (_genieGetLinkState() != GENIE_LINK_WFAN)
+        break;
+      _genieTxAcked(frame[0] == GENIE_ACK);
+      if (frame[0] == GENIE_NAK) {
+        _genieError = ERROR_NAK;
+        _handleError();
+      }
+      break;
+
+    case GENIE_REPORT_OBJ:
+      if (_genieGetLinkState() != GENIE_LINK_WF_RXREPORT)
+        break;  // nobody asked for it
+      _genieRttSample(GENIE_READ_OBJ, mstime_get() - _genieReadTime);
+      _geniePopLinkState();
+      if (!_genieProbing) {
+        _genieEnqueueEvent(frame);
+      }
+      break;
+
+    case GENIE_REPORT_EVENT:
+      _genieEnqueueEvent(frame);
+      _genieBroadcastEvent(frame);
+      break;
+  }
+  return GENIE_EVENT_RXCHAR;
+}
+#else
+///////////////////////// _genieDoEvent /////////////////////////
+//
+// This is the heart of the Genie comms state machine.
+//
+static int _genieDoEvent (void) 
+{
+  int c;
+
+  c = _genieGetchar();
+
+  if (_genieError == ERROR_NOCHAR) {
     return GENIE_EVENT_NONE;
   }
   
@@ -230,11 +627,11 @@ int genieDoEvents (void)
       switch (c) {
 
         case GENIE_ACK:
-          _geniePopLinkState();
+          _genieTxAcked(TRUE);
           return GENIE_EVENT_RXCHAR;
 
         case GENIE_NAK:
-          _geniePopLinkState();
+          _genieTxAcked(FALSE);
           _genieError = ERROR_NAK;
           _handleError();
           return GENIE_EVENT_RXCHAR;
@@ -295,30 +692,34 @@ int genieDoEvents (void)
   //
   if (_genieGetLinkState() == GENIE_LINK_RXREPORT || \
     _genieGetLinkState() == GENIE_LINK_RXEVENT) {
-      
-    checksum = (rxframe_count == 0) ? c : checksum ^ c;
 
-    rx_data[rxframe_count] = c;
-
-    if (rxframe_count == GENIE_FRAME_SIZE -1) {
-      // all bytes received, if the CS is good 
-      // queue the frame and restore the link state
-      if (checksum == 0) {
-        _genieEnqueueEvent(rx_data);
-        rxframe_count = 0;
+    switch (genieFramerByte(&_genieFramer, _genieRxFrame, c)) {
+      case GENIE_FRAME_DONE:
+        if (_genieGetLinkState() != GENIE_LINK_RXREPORT) {
+          _genieEnqueueEvent(_genieRxFrame);
+          _genieBroadcastEvent(_genieRxFrame);
+        } else {
+          _genieRttSample(GENIE_READ_OBJ, mstime_get() - _genieReadTime);
+          if (!_genieProbing) {
+            _genieEnqueueEvent(_genieRxFrame);
+          }
+        }
         // revert the link state to whatever it was before
         // we started accumulating this frame
         _geniePopLinkState();
-        return GENIE_EVENT_RXCHAR;
-      } else {
+        break;
+
+      case GENIE_FRAME_BAD_CS:
+        // drop the frame
         _genieError = ERROR_BAD_CS;
         _handleError();
-      }  
+        _geniePopLinkState();
+        break;
     }
-    rxframe_count++;
-    return GENIE_EVENT_RXCHAR;
   }
+  return GENIE_EVENT_RXCHAR;
 }
+#endif
 
 /////////////////// _genieFatalError ///////////////////////
 //
@@ -333,13 +734,22 @@ void _genieFatalError (void)
 ///////////////// _genieFlushSerialInput ///////////////////
 //
 // Removes and discards all characters from the currently 
-// used serial port's Rx buffer.
+// used serial port's Rx buffer. The cog driver is first asked
+// to drop any frame it is part way through, otherwise the 
+// next bytes would be taken as the rest of it.
 //
 void _genieFlushSerialInput (void) 
 {
+#ifdef GENIE_COG_DRIVER
+  _genieCog.rx_reset = TRUE;
+  for (long timeout = mstime_get() + _genieTimeout; 
+    _genieCog.rx_reset && mstime_get() < timeout;) ;
+  _genieCog.rx_tail = _genieCog.rx_head;
+#else
   do {
     _genieGetchar();
   } while (_genieError != ERROR_NOCHAR);
+#endif
 }
 
 /////////////////////// genieResync //////////////////////////
@@ -354,11 +764,13 @@ void genieResync (void)
 {
   for (long timeout = mstime_get() + RESYNC_PERIOD; mstime_get() < timeout;) {};
 
+  _genieLockLink();
   _genieFlushSerialInput();
   _genieFlushEventQueue();
   _genieTimeouts = 0;
-  _genieGetLinkState() == GENIE_LINK_IDLE;
+  _genieUnlockLink();
 
+  _genieResetLink();
 }
 
 ///////////////////////// _handleError /////////////////////////
@@ -393,8 +805,14 @@ void _genieFlushEventQueue (void)
 // Returns:  TRUE if there was an event to copy
 //      FALSE if not
 //
+// Holds _genieLock so _genieEnqueueEvent() cannot coalesce a new
+// value into the frame while it is being copied and retired.
+//
 bool genieDequeueEvent (genieFrame * buff) 
 {
+  bool copied = FALSE;
+
+  _genieLockLink();
   if (_genieEventQueue.n_events > 0) {
 
     for (int i = 0; i < GENIE_FRAME_SIZE; i++)
@@ -405,9 +823,33 @@ bool genieDequeueEvent (genieFrame * buff)
     _genieEventQueue.rd_index++;
     _genieEventQueue.rd_index &= MAX_GENIE_EVENTS -1;
     _genieEventQueue.n_events--;
-    return TRUE;
+    copied = TRUE;
   } 
-  return FALSE;
+  _genieUnlockLink();
+  return copied;
+}
+
+////////////////////// _genieEventCoalesces ///////////////////
+//
+// Returns:  TRUE if events from this type of object only carry
+//        the object's current value, so a newer event makes an 
+//        older undelivered one redundant
+//      FALSE for discrete events (buttons, forms, keyboards...)
+//        that must all be delivered in order
+//
+static bool _genieEventCoalesces (int object) 
+{
+  switch (object) {
+    case GENIE_OBJ_KNOB:
+    case GENIE_OBJ_ROTARYSW:
+    case GENIE_OBJ_SLIDER:
+    case GENIE_OBJ_TRACKBAR:
+    case GENIE_OBJ_COLORPICKER:
+      return TRUE;
+
+    default:
+      return FALSE;
+  }
 }
 
 ////////////////////// _genieEnqueueEvent ///////////////////
@@ -415,6 +857,11 @@ bool genieDequeueEvent (genieFrame * buff)
 // Copy the bytes from a buffer supplied by the caller 
 // to the input queue 
 //
+// Value events (see _genieEventCoalesces()) overwrite an 
+// undelivered event from the same object in place, so dragging
+// a slider occupies at most one queue entry. Called from 
+// genieDoEvents() with _genieLock held.
+//
 // Parms:  int * data, a pointer to the user's data
 //
 // Returns:  TRUE if there was an empty location in the queue
@@ -424,6 +871,20 @@ bool genieDequeueEvent (genieFrame * buff)
 //
 bool _genieEnqueueEvent (int * data) 
 {
+  genieFrame *f;
+
+  if (data[0] == GENIE_REPORT_EVENT && _genieEventCoalesces(data[1])) {
+    for (int i = 0; i < _genieEventQueue.n_events; i++) {
+      f = &_genieEventQueue.frames[(_genieEventQueue.rd_index + i) & (MAX_GENIE_EVENTS -1)];
+      if (genieEventIs(f, GENIE_REPORT_EVENT, data[1], data[2])) {
+        f->reportObject.data_msb = data[3];
+        f->reportObject.data_lsb = data[4];
+        f->reportObject.checksum = data[5];
+        return TRUE;
+      }
+    }
+  }
+
   if (_genieEventQueue.n_events < MAX_GENIE_EVENTS-2) {
 //    memcpy (&_genieEventQueue.frames[_genieEventQueue.wr_index], data, 
   //      GENIE_FRAME_SIZE);
@@ -442,119 +903,341 @@ bool _genieEnqueueEvent (int * data)
   }
 }
 
-//////////////////////// genieReadObject ///////////////////////
+///////////////////// _genieBroadcastEvent ///////////////////
 //
-// Send a read object command to the Genie display. Note that this 
-// function does not wait for the reply, that will be read in due 
-// course by genieDoEvents() and subsequently by the user's event 
-// handler.
+// Copy an event frame to the broadcast ring, overwriting the 
+// oldest. The sequence number moves on only once the frame is 
+// complete, so subscribers never see half a frame.
 //
-bool genieReadObject (int object, int index) 
+void _genieBroadcastEvent (int * data) 
 {
-  int checksum;
-
-  _genieFlushEventQueue();  // Discard any pending reply frames
-
-  _genieWaitForIdle();
-
-  _genieError = ERROR_NONE;
-
-  _geniePutchar(GENIE_READ_OBJ); checksum   = GENIE_READ_OBJ;
-  _geniePutchar(object);         checksum  ^= object;
-  _geniePutchar(index);          checksum  ^= index;
-  _geniePutchar(checksum);
+  volatile genieFrame *f;
 
-  _geniePushLinkState(GENIE_LINK_WF_RXREPORT);
+  if (data[0] != GENIE_REPORT_EVENT)
+    return;
 
-  return TRUE;
+  f = &_genieBroadcast[_genieBroadcastSeq & (MAX_GENIE_BROADCAST -1)];
+  for (int j = 0; j < GENIE_FRAME_SIZE; j++) {
+    f->bytes[j] = data[j];
+  }
+  _genieBroadcastSeq++;
 }
 
-
-///////////////////// _genieSetLinkState ////////////////////////
+///////////////////////// genieSubscribe ///////////////////////////
 //
-// Set the logical state of the link to the display.
+// Register a new reader of the event broadcast. It sees events 
+// that arrive from now on. Any cog may call it, the search for a 
+// free id is done under the link lock.
 //
-// Parms:  int newstate, a value to be written to the 
-//        link's _genieLinkState variable. Valid values are
-//    GENIE_LINK_IDLE      0
-//    GENIE_LINK_WFAN      1 // waiting for Ack or Nak
-//    GENIE_LINK_WF_RXREPORT  2 // waiting for a report frame
-//    GENIE_LINK_RXREPORT    3 // receiving a report frame
-//    GENIE_LINK_RXEVENT    4 // receiving an event frame
-//    GENIE_LINK_SHDN      5
+// Parms:  int object, the type of object whose events are 
+//        wanted, eg GENIE_OBJ_4DBUTTON, or GENIE_SUBSCRIBE_ALL
 //
-void _genieSetLinkState (int newstate) 
+// Returns:  The subscriber id
+//      -1 if MAX_GENIE_SUBSCRIBERS are already registered
+//
+int genieSubscribe (int object) 
 {
-  *_genieLinkState = newstate;
-
-  if (newstate == GENIE_LINK_RXREPORT || \
-    newstate == GENIE_LINK_RXEVENT)
-    rxframe_count = 0;  
+  genieSubscriberStruct *sub;
+
+  _genieLockLink();
+  for (int id = 0; id < MAX_GENIE_SUBSCRIBERS; id++) {
+    sub = &_genieSubscribers[id];
+    if (!sub->in_use) {
+      sub->object = object;
+      sub->rd_seq = _genieBroadcastSeq;
+      sub->overruns = 0;
+      sub->in_use = TRUE;
+      _genieUnlockLink();
+      return id;
+    }
+  }
+  _genieUnlockLink();
+  return -1;
 }
 
-/////////////////////// _genieGetLinkState //////////////////////
+//////////////////////// genieUnsubscribe //////////////////////////
 //
-// Get the current logical state of the link to the display.
+// Free a subscriber id returned by genieSubscribe()
 //
-int _genieGetLinkState (void) 
+void genieUnsubscribe (int id) 
 {
-  return *_genieLinkState;
+  if (id < 0 || id >= MAX_GENIE_SUBSCRIBERS)
+    return;
+
+  _genieSubscribers[id].in_use = FALSE;
 }
 
-///////////////////////// genieWriteObject //////////////////////
+///////////////////// genieSubscriberDequeue ////////////////////////
 //
-// Write data to an object on the display
+// Copy the subscriber's next event that passes its filter to a 
+// buffer supplied by the caller. Only the subscriber's own read
+// position moves, so other subscribers still get the event. 
+// Events overwritten before they could be read are counted, see
+// genieSubscriberOverruns().
 //
-int genieWriteObject (int object, int index, int data)
+// Parms:  int id, the subscriber id
+//      genieFrame * buff, a pointer to the user's buffer
+//
+// Returns:  TRUE if there was an event to copy
+//      FALSE if not, or id is not a registered subscriber id
+//
+bool genieSubscriberDequeue (int id, genieFrame * buff) 
 {
-  int msb, lsb;
-  int checksum;
+  genieSubscriberStruct *sub;
+  volatile genieFrame *f;
+  unsigned int seq;
 
-  _genieWaitForIdle();
+  if (id < 0 || id >= MAX_GENIE_SUBSCRIBERS || !_genieSubscribers[id].in_use)
+    return FALSE;
 
-  lsb = data & 0xFF;
-  msb = (data >> 8) & 0xFF;
+  sub = &_genieSubscribers[id];
 
-  _genieError = ERROR_NONE;
+  while (sub->rd_seq != (seq = _genieBroadcastSeq)) {
+    // the slot about to be overwritten next counts as lost too
+    if (seq - sub->rd_seq >= MAX_GENIE_BROADCAST) {
+      sub->overruns += seq - sub->rd_seq - MAX_GENIE_BROADCAST + 1;
+      sub->rd_seq = seq - MAX_GENIE_BROADCAST + 1;
+    }
 
-  _geniePutchar(GENIE_WRITE_OBJ); checksum  = GENIE_WRITE_OBJ;
-  _geniePutchar(object);          checksum ^= object;
-  _geniePutchar(index);           checksum ^= index;
+    f = &_genieBroadcast[sub->rd_seq & (MAX_GENIE_BROADCAST -1)];
+    for (int i = 0; i < GENIE_FRAME_SIZE; i++) {
+      buff->bytes[i] = f->bytes[i];
+    }
+
+    // if the writer lapped us while copying the frame may be
+    // torn, go round again and start from the oldest good one
+    if (_genieBroadcastSeq - sub->rd_seq >= MAX_GENIE_BROADCAST) {
+      continue;
+    }
+
+    sub->rd_seq++;
+    if (sub->object == GENIE_SUBSCRIBE_ALL || 
+      buff->reportObject.object == sub->object) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+///////////////////// genieSubscriberOverruns ///////////////////////
+//
+// Returns:  The number of events the subscriber has lost by 
+//        falling more than MAX_GENIE_BROADCAST events behind
+//      0 if id is not a registered subscriber id
+//
+int genieSubscriberOverruns (int id) 
+{
+  if (id < 0 || id >= MAX_GENIE_SUBSCRIBERS || !_genieSubscribers[id].in_use)
+    return 0;
+
+  return _genieSubscribers[id].overruns;
+}
+
+//////////////////////// genieReadObject ///////////////////////
+//
+// Send a read object command to the Genie display. Note that this 
+// function does not wait for the reply, that will be read in due 
+// course by genieDoEvents() and subsequently by the user's event 
+// handler.
+//
+bool genieReadObject (int object, int index) 
+{
+  _genieLockLink();
+  _genieFlushEventQueue();  // Discard any pending reply frames
+  _genieUnlockLink();
+
+  _genieWaitForIdle();
+
+  _genieError = ERROR_NONE;
+
+  _genieTxRead(object, index);
+
+  return TRUE;
+}
+
+////////////////////////// _genieTxRead ///////////////////////////
+//
+// Send a read object command and set the link state to wait for
+// the report frame. Returns without waiting for it.
+//
+static void _genieTxRead (int object, int index) 
+{
+  int checksum;
+
+  _geniePutchar(GENIE_READ_OBJ); checksum   = GENIE_READ_OBJ;
+  _geniePutchar(object);         checksum  ^= object;
+  _geniePutchar(index);          checksum  ^= index;
+  _geniePutchar(checksum);
+
+  _genieLockLink();
+  _genieReadTime = mstime_get();
+  _geniePushLinkState(GENIE_LINK_WF_RXREPORT);
+  _genieUnlockLink();
+}
+
+///////////////////////// genieWaitReady ///////////////////////////
+//
+// Wait for the display to finish booting. It is asked for the
+// current form every PROBE_PERIOD mS and is ready as soon as the
+// first report comes back. Writes still waiting for an ACK and
+// anything already received are forgotten, the display has been
+// reset. The probe's report is not queued, events that arrive
+// meanwhile are.
+//
+// Parms:  int deadline, mS to wait before giving up
+//
+// Returns:  ERROR_NONE once the display has answered, the time
+//        taken is in the boot_time statistic
+//      ERROR_NODISPLAY if it did not answer in time
+//
+int genieWaitReady (int deadline) 
+{
+  long start = mstime_get();
+  long probe;
+
+  _genieProbing = TRUE;
+
+  // whatever arrived while the display was resetting is noise
+  _genieLockLink();
+  _genieFlushSerialInput();
+  _genieUnlockLink();
+
+  while (mstime_get() - start < deadline) {
+    _genieResetLink();
+
+    _genieTxRead(GENIE_OBJ_FORM, 0);
+
+    for (probe = mstime_get() + PROBE_PERIOD; mstime_get() < probe;) {
+      genieDoEvents();
+      if (_genieGetLinkState() == GENIE_LINK_IDLE) {
+        _genieStats.boot_time = mstime_get() - start;
+        _genieProbing = FALSE;
+        return ERROR_NONE;
+      }
+    }
+  }
+
+  _genieResetLink();
+  _genieProbing = FALSE;
+  _genieError = ERROR_NODISPLAY;
+  _handleError();
+  return ERROR_NODISPLAY;
+}
+
+
+///////////////////// _genieSetLinkState ////////////////////////
+//
+// Set the logical state of the link to the display.
+//
+// Parms:  int newstate, a value to be written to the 
+//        link's _genieLinkState variable. Valid values are
+//    GENIE_LINK_IDLE      0
+//    GENIE_LINK_WFAN      1 // waiting for Ack or Nak
+//    GENIE_LINK_WF_RXREPORT  2 // waiting for a report frame
+//    GENIE_LINK_RXREPORT    3 // receiving a report frame
+//    GENIE_LINK_RXEVENT    4 // receiving an event frame
+//    GENIE_LINK_SHDN      5
+//
+void _genieSetLinkState (int newstate) 
+{
+  *_genieLinkState = newstate;
+
+#ifndef GENIE_COG_DRIVER
+  if (newstate == GENIE_LINK_RXREPORT || \
+    newstate == GENIE_LINK_RXEVENT)
+    _genieFramer.count = 0;  
+#endif
+}
+
+/////////////////////// _genieGetLinkState //////////////////////
+//
+// Get the current logical state of the link to the display.
+//
+int _genieGetLinkState (void) 
+{
+  return *_genieLinkState;
+}
+
+////////////////////// _genieWriteObjectX //////////////////////
+//
+// Non-user function used by genieWriteObject() and
+// genieBatchCommit(), entry is the batch entry or -1
+//
+static int _genieWriteObjectX (int object, int index, int data, int entry)
+{
+  int msb, lsb;
+  int checksum;
+
+  _genieWaitForSlot(GENIE_WRITE_OBJ);
+
+  lsb = data & 0xFF;
+  msb = (data >> 8) & 0xFF;
+
+  _genieError = ERROR_NONE;
+
+  _geniePutchar(GENIE_WRITE_OBJ); checksum  = GENIE_WRITE_OBJ;
+  _geniePutchar(object);          checksum ^= object;
+  _geniePutchar(index);           checksum ^= index;
   _geniePutchar(msb);             checksum ^= msb;
   _geniePutchar(lsb);             checksum ^= lsb;
   _geniePutchar(checksum);
 
-  _geniePushLinkState(GENIE_LINK_WFAN);
-  
+  _genieTxSent(GENIE_WRITE_OBJ, entry);
+
+  _genieSnapshotObj(object, index, data);
+
+  return 0;
 }
 
-/////////////////////// genieWriteContrast //////////////////////
-// 
-// Alter the display contrast (backlight)
+///////////////////////// genieWriteObject //////////////////////
 //
-// Parms:  int value: The required contrast setting, only
-//    values from 0 to 15 are valid. 0 or 1 for most displays
-//      and 0 to 15 for the uLCD-43
+// Write data to an object on the display
 //
-void genieWriteContrast (int value) 
+int genieWriteObject (int object, int index, int data)
+{
+  return _genieWriteObjectX(object, index, data, -1);
+}
+
+/////////////////////// _genieWriteContrastX //////////////////////
+//
+// Non-user function used by genieWriteContrast() and
+// genieBatchCommit(), entry is the batch entry or -1
+//
+static void _genieWriteContrastX (int value, int entry) 
 {
   unsigned int checksum;
 
-  _genieWaitForIdle();
+  _genieWaitForSlot(GENIE_WRITE_CONTRAST);
 
   _geniePutchar(GENIE_WRITE_CONTRAST); checksum  = GENIE_WRITE_CONTRAST;
   _geniePutchar(value);                checksum ^= value;
   _geniePutchar(checksum);
 
-  _geniePushLinkState(GENIE_LINK_WFAN);
+  _genieTxSent(GENIE_WRITE_CONTRAST, entry);
+
+  _genieSnapshot.contrast = value;
 
 }
 
+/////////////////////// genieWriteContrast //////////////////////
+// 
+// Alter the display contrast (backlight)
+//
+// Parms:  int value: The required contrast setting, only
+//    values from 0 to 15 are valid. 0 or 1 for most displays
+//      and 0 to 15 for the uLCD-43
+//
+void genieWriteContrast (int value) 
+{
+  _genieWriteContrastX(value, -1);
+}
+
 //////////////////////// _genieWriteStrX ///////////////////////
 //
-// Non-user function used by genieWriteStr() and genieWriteStrU()
+// Non-user function used by genieWriteStr(), genieBatchCommit()
+// and genieSnapshotRestore(), entry is the batch entry or -1
 //
-static int _genieWriteStrX (int code, int index, char *string)
+static int _genieWriteStrX (int code, int index, char *string, int entry)
 {
   char *p;
   unsigned int checksum;
@@ -563,7 +1246,7 @@ static int _genieWriteStrX (int code, int index, char *string)
   if (len > 255)
   return -1;
 
-  _genieWaitForIdle();
+  _genieWaitForSlot(code);
 
   _geniePutchar(code);               checksum  = code;
   _geniePutchar(index);              checksum ^= index;
@@ -574,7 +1257,7 @@ static int _genieWriteStrX (int code, int index, char *string)
   }
   _geniePutchar(checksum);
 
-  _geniePushLinkState(GENIE_LINK_WFAN);
+  _genieTxSent(code, entry);
 
   return 0;
 }
@@ -585,16 +1268,572 @@ static int _genieWriteStrX (int code, int index, char *string)
 //
 int genieWriteStr (int index, char *string) 
 {
-  return _genieWriteStrX (GENIE_WRITE_STR, index, string);
+  if (_genieWriteStrX (GENIE_WRITE_STR, index, string, -1) < 0)
+    return -1;
+
+  _genieSnapshotStr(index, string);
+  return 0;
+}
+
+/////////////////////// genieWriteFixed ////////////////////////
+//
+// Write a fixed point number to a strings object on the display.
+// The text is generated digit by digit as it is sent, there is 
+// no intermediate string and no printf.
+//
+// Parms:  int index, the strings object
+//      int value, the number scaled by 10^decimals, eg 1234 
+//        with 2 decimals is written as "12.34"
+//      int decimals, digits after the decimal point, 0 for none,
+//        at most 9
+//      int width, minimum width of the number, not counting 
+//        the units
+//      int flags, GENIE_FMT_ZEROPAD and/or GENIE_FMT_PLUS
+//      char * units, text to append, or NULL
+//
+// Returns:  0 if the string was sent
+//      -1 if it would be longer than 255 characters or 
+//        decimals is more than 9
+//
+int genieWriteFixed (int index, int value, int decimals, int width, int flags, char *units) 
+{
+  unsigned int mag, div;
+  unsigned int checksum;
+  int digits, sign, pad, len;
+  char *p;
+
+  // 10^decimals must fit in an unsigned int
+  if (decimals > 9)
+    return -1;
+  if (decimals < 0)
+    decimals = 0;
+
+  mag  = (value < 0) ? -(unsigned int)value : value;
+  sign = (value < 0) ? '-' : (flags & GENIE_FMT_PLUS) ? '+' : 0;
+
+  // count the digits, always at least one before the point
+  digits = 1;
+  for (div = 1; mag / div >= 10; div *= 10) digits++;
+  while (digits <= decimals) {
+    digits++;
+    div *= 10;
+  }
+
+  len = digits + (sign != 0) + (decimals > 0);
+  pad = (width > len) ? width - len : 0;
+  len += pad + (units ? strlen(units) : 0);
+
+  if (len > 255)
+  return -1;
+
+  _genieWaitForSlot(GENIE_WRITE_STR);
+
+  _geniePutchar(GENIE_WRITE_STR);    checksum  = GENIE_WRITE_STR;
+  _geniePutchar(index);              checksum ^= index;
+  _geniePutchar(len);                checksum ^= len;
+
+  if (!(flags & GENIE_FMT_ZEROPAD)) {
+    for (; pad > 0; pad--) {
+      _geniePutchar(' ');            checksum ^= ' ';
+    }
+  }
+  if (sign) {
+    _geniePutchar(sign);             checksum ^= sign;
+  }
+  for (; pad > 0; pad--) {
+    _geniePutchar('0');              checksum ^= '0';
+  }
+  for (; digits > 0; digits--, div /= 10) {
+    if (digits == decimals) {
+      _geniePutchar('.');            checksum ^= '.';
+    }
+    _geniePutchar('0' + mag / div);  checksum ^= '0' + mag / div;
+    mag %= div;
+  }
+  for (p = units; p && *p; ++p) {
+    _geniePutchar(*p);               checksum ^= *p;
+  }
+  _geniePutchar(checksum);
+
+  _genieTxSent(GENIE_WRITE_STR, -1);
+
+  // the text is not kept anywhere, so it cannot be restored
+  _genieSnapshotStr(index, NULL);
+
+  return 0;
+}
+
+/////////////////////// genieWriteInt ////////////////////////////
+//
+// Write an integer to a strings object on the display, see 
+// genieWriteFixed()
+//
+int genieWriteInt (int index, int value, int width, int flags, char *units) 
+{
+  return genieWriteFixed(index, value, 0, width, flags, units);
+}
+
+/////////////////////// _genieUtf8Next ////////////////////////
+//
+// Decode one character from a UTF-8 string and advance past it.
+// Malformed sequences, overlong encodings (eg C0 80 for U+0000),
+// UTF-16 surrogates and characters outside the Basic Multilingual
+// Plane, which the display cannot show, decode as U+FFFD.
+//
+// Parms:  unsigned char ** p, pointer to the string pointer
+//
+// Returns:  The UCS-2 code unit, 0 at the end of the string
+//
+static int _genieUtf8Next (unsigned char ** p) 
+{
+  unsigned char *s = *p;
+  int c = *s++;
+  int n, min;
+
+  if (c < 0x80) {
+    n = 0;  min = 0;
+  } else if ((c & 0xE0) == 0xC0) {
+    n = 1;  min = 0x80;   c &= 0x1F;
+  } else if ((c & 0xF0) == 0xE0) {
+    n = 2;  min = 0x800;  c &= 0x0F;
+  } else {
+    // stray continuation byte or 4-byte (non BMP) lead byte,
+    // skip the rest of the sequence
+    while ((*s & 0xC0) == 0x80) s++;
+    *p = s;
+    return 0xFFFD;
+  }
+
+  for (; n > 0; n--) {
+    if ((*s & 0xC0) != 0x80) {
+      *p = s;
+      return 0xFFFD;
+    }
+    c = (c << 6) | (*s++ & 0x3F);
+  }
+  *p = s;
+
+  if (c < min || (c >= 0xD800 && c <= 0xDFFF))
+    return 0xFFFD;
+  return c;
+}
+
+/////////////////////// _genieUtf8Len ////////////////////////
+//
+// Returns:  The number of characters in a UTF-8 string
+//
+static int _genieUtf8Len (char *string) 
+{
+  unsigned char *p;
+  int len = 0;
+
+  for (p = (unsigned char *) string; *p; len++) {
+    _genieUtf8Next(&p);
+  }
+  return len;
+}
+
+/////////////////////// _genieWriteStrUX ////////////////////////
+//
+// Non-user function used by genieWriteStrU() and
+// genieBatchCommit(), entry is the batch entry or -1
+//
+static int _genieWriteStrUX (int index, char *string, int entry) 
+{
+  unsigned char *p;
+  unsigned int checksum;
+  int c;
+  int len = _genieUtf8Len(string);
+
+  if (len > 255)
+  return -1;
+
+  _genieWaitForSlot(GENIE_WRITE_STRU);
+
+  _geniePutchar(GENIE_WRITE_STRU);   checksum  = GENIE_WRITE_STRU;
+  _geniePutchar(index);              checksum ^= index;
+  _geniePutchar((unsigned char)len); checksum ^= len;
+  for (p = (unsigned char *) string; len > 0; len--) {
+    c = _genieUtf8Next(&p);
+    _geniePutchar(c >> 8);           checksum ^= c >> 8;
+    _geniePutchar(c & 0xFF);         checksum ^= c & 0xFF;
+  }
+  _geniePutchar(checksum);
+
+  _genieTxSent(GENIE_WRITE_STRU, entry);
+
+  // only ASCII strings are kept, so it cannot be restored
+  _genieSnapshotStr(index, NULL);
+
+  return 0;
 }
 
 /////////////////////// genieWriteStrU ////////////////////////
 //
 // Write a string to the display (Unicode)
 //
+// The string is UTF-8. It is sent as UCS-2, each character
+// encoded on the fly as it is written so no wide copy of the 
+// string is needed.
+//
+// Returns:  0 if the string was sent
+//      -1 if it is longer than 255 characters
+//
 int genieWriteStrU (int index, char *string) 
 {
-  return _genieWriteStrX (GENIE_WRITE_STRU, index, string);
+  return _genieWriteStrUX(index, string, -1);
+}
+
+//////////////////////// genieBatchBegin //////////////////////////
+//
+// Start a new batch of writes, discarding any earlier one
+//
+void genieBatchBegin (void) 
+{
+  _genieBatchCount = 0;
+}
+
+///////////////////////// _genieBatchAdd ///////////////////////////
+//
+// Queue a write in the batch
+//
+// Returns:  The entry number, for genieBatchResult()
+//      -1 if the batch is full
+//
+static int _genieBatchAdd (int cmd, int object, int index, int data, char *string) 
+{
+  genieBatchEntry *e;
+
+  if (_genieBatchCount == MAX_GENIE_BATCH)
+    return -1;
+
+  e = &_genieBatch[_genieBatchCount];
+  e->cmd = cmd;
+  e->object = object;
+  e->index = index;
+  e->data = data;
+  e->string = string;
+  e->result = ERROR_TIMEOUT;
+  return _genieBatchCount++;
+}
+
+///////////////////// genieBatchWriteObject ////////////////////////
+//
+// Queue a genieWriteObject() in the batch, see _genieBatchAdd()
+//
+int genieBatchWriteObject (int object, int index, int data) 
+{
+  return _genieBatchAdd(GENIE_WRITE_OBJ, object, index, data, NULL);
+}
+
+//////////////////// genieBatchWriteContrast ///////////////////////
+//
+// Queue a genieWriteContrast() in the batch, see _genieBatchAdd()
+//
+int genieBatchWriteContrast (int value) 
+{
+  return _genieBatchAdd(GENIE_WRITE_CONTRAST, 0, 0, value, NULL);
+}
+
+////////////////////// genieBatchWriteStr //////////////////////////
+//
+// Queue a genieWriteStr() in the batch, see _genieBatchAdd(). 
+// Strings too long to send are refused here, -1.
+//
+int genieBatchWriteStr (int index, char *string) 
+{
+  if (strlen(string) > 255)
+    return -1;
+  return _genieBatchAdd(GENIE_WRITE_STR, 0, index, 0, string);
+}
+
+////////////////////// genieBatchWriteStrU /////////////////////////
+//
+// Queue a genieWriteStrU() in the batch, see genieBatchWriteStr()
+//
+int genieBatchWriteStrU (int index, char *string) 
+{
+  if (_genieUtf8Len(string) > 255)
+    return -1;
+  return _genieBatchAdd(GENIE_WRITE_STRU, 0, index, 0, string);
+}
+
+/////////////////////// genieBatchCommit ///////////////////////////
+//
+// Send the batch as one burst and wait for every reply. Entries
+// that were NAKed or timed out are then sent again, in order, up
+// to retries more times.
+//
+// Returns:  The number of entries that still failed, 0 if the
+//        whole batch was written. genieBatchResult() says which.
+//
+int genieBatchCommit (int retries) 
+{
+  genieBatchEntry *e;
+  int failed = _genieBatchCount;
+
+  for (; retries >= 0 && failed > 0; retries--) {
+    for (int i = 0; i < _genieBatchCount; i++) {
+      e = &_genieBatch[i];
+      if (e->result == ERROR_NONE)
+        continue;
+
+      e->result = ERROR_TIMEOUT;  // until a reply says otherwise
+      switch (e->cmd) {
+        case GENIE_WRITE_OBJ:
+          _genieWriteObjectX(e->object, e->index, e->data, i);
+          break;
+
+        case GENIE_WRITE_CONTRAST:
+          _genieWriteContrastX(e->data, i);
+          break;
+
+        case GENIE_WRITE_STR:
+          if (_genieWriteStrX(GENIE_WRITE_STR, e->index, e->string, i) == 0)
+            _genieSnapshotStr(e->index, e->string);
+          break;
+
+        case GENIE_WRITE_STRU:
+          _genieWriteStrUX(e->index, e->string, i);
+          break;
+      }
+    }
+
+    _genieWaitForIdle();
+
+    failed = 0;
+    for (int i = 0; i < _genieBatchCount; i++) {
+      if (_genieBatch[i].result != ERROR_NONE) failed++;
+    }
+  }
+  return failed;
+}
+
+/////////////////////// genieBatchResult ///////////////////////////
+//
+// Returns:  ERROR_NONE if the entry was ACKed by the last commit
+//      ERROR_NAK if the display refused it
+//      ERROR_TIMEOUT if there was no reply
+//      ERROR_NOENTRY if the batch has no such entry
+//
+int genieBatchResult (int entry) 
+{
+  if (entry < 0 || entry >= _genieBatchCount)
+    return ERROR_NOENTRY;
+
+  return _genieBatch[entry].result;
+}
+
+/////////////////////// _genieSnapshotObj /////////////////////////
+//
+// Remember the value written to an object. Writing a form only
+// remembers which form is showing.
+//
+void _genieSnapshotObj (int object, int index, int data) 
+{
+  genieSnapshotObj *o;
+  int i;
+
+  if (object == GENIE_OBJ_FORM) {
+    _genieSnapshot.form = index;
+    return;
+  }
+
+  for (i = 0; i < _genieSnapshot.n_objs; i++) {
+    o = &_genieSnapshot.objs[i];
+    if (o->object == object && o->index == index) {
+      o->value = data;
+      return;
+    }
+  }
+
+  if (i < GENIE_SNAPSHOT_OBJS) {
+    o = &_genieSnapshot.objs[i];
+    o->object = object;
+    o->index = index;
+    o->has_default = FALSE;
+    o->value = data;
+    _genieSnapshot.n_objs++;
+  }
+}
+
+/////////////////////// _genieSnapshotStr /////////////////////////
+//
+// Remember the text written to a strings object. NULL, or text
+// too long to keep, forgets the object so a stale string is 
+// never restored.
+//
+void _genieSnapshotStr (int index, char *string) 
+{
+  int i;
+
+  for (i = 0; i < _genieSnapshot.n_strs; i++) {
+    if (_genieSnapshot.str_index[i] == index)
+      break;
+  }
+
+  if (string == NULL || strlen(string) >= GENIE_SNAPSHOT_STRLEN) {
+    if (i < _genieSnapshot.n_strs) {
+      // move the last entry into the hole, unless it was the last
+      _genieSnapshot.n_strs--;
+      if (i < _genieSnapshot.n_strs) {
+        _genieSnapshot.str_index[i] = _genieSnapshot.str_index[_genieSnapshot.n_strs];
+        strcpy(_genieSnapshot.strs[i], _genieSnapshot.strs[_genieSnapshot.n_strs]);
+      }
+    }
+    return;
+  }
+
+  if (i == GENIE_SNAPSHOT_STRS)
+    return;
+
+  if (i == _genieSnapshot.n_strs) {
+    _genieSnapshot.str_index[i] = index;
+    _genieSnapshot.n_strs++;
+  }
+  strcpy(_genieSnapshot.strs[i], string);
+}
+
+/////////////////////// genieSnapshotClear ////////////////////////
+//
+// Forget everything written to the display so far
+//
+void genieSnapshotClear (void) 
+{
+  _genieSnapshot.form = -1;
+  _genieSnapshot.contrast = -1;
+  _genieSnapshot.n_objs = 0;
+  _genieSnapshot.n_strs = 0;
+}
+
+////////////////////// genieSnapshotDefault ///////////////////////
+//
+// Tell the snapshot the value an object has when its form is 
+// first shown, as set in Workshop. genieSnapshotRestore() skips 
+// objects that still hold their default. A value already written
+// to the object is kept.
+//
+void genieSnapshotDefault (int object, int index, int data) 
+{
+  int i;
+
+  if (object == GENIE_OBJ_FORM)
+    return;
+
+  for (i = 0; i < _genieSnapshot.n_objs; i++) {
+    if (_genieSnapshot.objs[i].object == object && 
+      _genieSnapshot.objs[i].index == index)
+      break;
+  }
+
+  if (i == _genieSnapshot.n_objs) {
+    // not written yet, so it holds its default
+    _genieSnapshotObj(object, index, data);
+    if (i == _genieSnapshot.n_objs)
+      return;  // snapshot full
+  }
+
+  _genieSnapshot.objs[i].has_default = TRUE;
+  _genieSnapshot.objs[i].dflt = data;
+}
+
+////////////////////// genieSnapshotRestore ///////////////////////
+//
+// Put the display back the way it was, eg after it has been 
+// reset: the form first, then the contrast, every object not at
+// its default and every string. The writes go out back to back
+// as fast as the link's window allows.
+//
+// Returns:  The number of writes sent
+//      ERROR_TIMEOUT if the display stopped answering
+//
+int genieSnapshotRestore (void) 
+{
+  genieSnapshotObj *o;
+  int sent = 0;
+  int timeouts = _genieTimeouts;
+
+  if (_genieSnapshot.form >= 0) {
+    genieWriteObject(GENIE_OBJ_FORM, _genieSnapshot.form, 0);
+    sent++;
+  }
+  if (_genieSnapshot.contrast >= 0) {
+    genieWriteContrast(_genieSnapshot.contrast);
+    sent++;
+  }
+  for (int i = 0; i < _genieSnapshot.n_objs; i++) {
+    o = &_genieSnapshot.objs[i];
+    if (!o->has_default || o->value != o->dflt) {
+      genieWriteObject(o->object, o->index, o->value);
+      sent++;
+    }
+  }
+  for (int i = 0; i < _genieSnapshot.n_strs; i++) {
+    _genieWriteStrX(GENIE_WRITE_STR, _genieSnapshot.str_index[i], _genieSnapshot.strs[i], -1);
+    sent++;
+  }
+
+  _genieWaitForIdle();
+
+  return (_genieTimeouts != timeouts) ? ERROR_TIMEOUT : sent;
+}
+
+////////////////////// _genieSnapshotEeOk ////////////////////////
+//
+// Returns:  TRUE if the snapshot's place in EEPROM is clear of the
+//        program image and inside the EEPROM, see Genie.h
+//
+static bool _genieSnapshotEeOk (void) 
+{
+  return GENIE_SNAPSHOT_EE_ADDR >= GENIE_EE_IMAGE_SIZE &&
+    GENIE_SNAPSHOT_EE_ADDR + sizeof(genieSnapshotStruct) <= GENIE_EE_SIZE;
+}
+
+/////////////////////// genieSnapshotSave /////////////////////////
+//
+// Copy the snapshot to EEPROM at GENIE_SNAPSHOT_EE_ADDR.
+//
+// Returns:  ERROR_NONE if the snapshot was saved
+//      ERROR_NOSNAPSHOT if there is no room for it outside the 
+//        program image, nothing is written
+//
+int genieSnapshotSave (void) 
+{
+  if (!_genieSnapshotEeOk())
+    return ERROR_NOSNAPSHOT;
+
+  ee_putStr((unsigned char *) &_genieSnapshot, sizeof(_genieSnapshot), GENIE_SNAPSHOT_EE_ADDR);
+  return ERROR_NONE;
+}
+
+/////////////////////// genieSnapshotLoad /////////////////////////
+//
+// Replace the snapshot with the one saved by genieSnapshotSave().
+// Follow with genieSnapshotRestore() to send it to the display.
+//
+// Returns:  ERROR_NONE if a saved snapshot was loaded
+//      ERROR_NOSNAPSHOT if there was none, the current 
+//        snapshot is left as it was
+//
+int genieSnapshotLoad (void) 
+{
+  genieSnapshotStruct saved;
+
+  if (!_genieSnapshotEeOk())
+    return ERROR_NOSNAPSHOT;
+
+  ee_getStr((unsigned char *) &saved, sizeof(saved), GENIE_SNAPSHOT_EE_ADDR);
+
+  if (saved.magic != GENIE_SNAPSHOT_MAGIC ||
+    saved.n_objs < 0 || saved.n_objs > GENIE_SNAPSHOT_OBJS ||
+    saved.n_strs < 0 || saved.n_strs > GENIE_SNAPSHOT_STRS)
+    return ERROR_NOSNAPSHOT;
+
+  for (int i = 0; i < GENIE_SNAPSHOT_STRS; i++) {
+    saved.strs[i][GENIE_SNAPSHOT_STRLEN -1] = 0;
+  }
+  _genieSnapshot = saved;
+  return ERROR_NONE;
 }
 
 /////////////////// genieAttachEventHandler //////////////////////
@@ -607,6 +1846,21 @@ void genieAttachEventHandler (genieUserEventHandlerPtr handler)
   _genieUserHandler = handler;
 }
 
+#ifdef GENIE_COG_DRIVER
+/////////////////////// _geniePutchar ///////////////////////////
+//
+// Output the supplied character to the Genie display through the
+// cog driver, waiting for room in its buffer
+//
+void _geniePutchar (int c) 
+{
+  int next = (_genieCog.tx_head + 1) & (GENIE_COG_TXBUF -1);
+
+  while (next == _genieCog.tx_tail) ;
+  _genieCog.tx_buf[_genieCog.tx_head] = c;
+  _genieCog.tx_head = next;
+}
+#else
 //////////////////////// _genieGetchar //////////////////////////
 //
 // Get a character from the selected Genie serial port
@@ -617,15 +1871,21 @@ void genieAttachEventHandler (genieUserEventHandlerPtr handler)
 //      The char if there was one to get
 // Sets:  _genieError with any errors encountered
 //
+// fdserial_rxCheck() both tests and takes the byte, one trip to
+// the driver's hub buffer per byte instead of two.
+//
 int _genieGetchar () 
 {
+  int c;
+
   _genieError = ERROR_NONE;
 
-  if (fdserial_rxReady(term) == 0) {
+  c = fdserial_rxCheck(term);
+  if (c < 0) {
     _genieError = ERROR_NOCHAR;
     return ERROR_NOCHAR;  
   }  
-  return (int) fdserial_rxChar(term) & 0xFF;
+  return c & 0xFF;
 }
 
 
@@ -638,6 +1898,7 @@ void _geniePutchar (int c)
 {
   fdserial_txChar(term, c);
 }
+#endif
 
 void runMonitor(void *par)
 {
@@ -655,9 +1916,25 @@ void runMonitor(void *par)
 // rstTime - # of ms to keep reset line low. 
 // baud - Baud rate to connect to 4D Display.
 //
+// Returns once the display answers, TRUE, or after 
+// BOOT_TIMEOUT_PERIOD mS without an answer, FALSE.
+//
 int genieBegin (int rxpin, int txpin, int rstpin, int rstTime, int baud)
 {
+  // must exist before the monitor cog starts calling genieDoEvents()
+  _genieLock = locknew();
+  if (_genieLock < 0)
+    return FALSE;
+
+#ifdef GENIE_COG_DRIVER
+  _genieCog.rxpin = rxpin;
+  _genieCog.txpin = txpin;
+  _genieCog.bit_ticks = CLKFREQ / baud;
+  if (cognew(_load_start_genie_uart_cog, &_genieCog) < 0)
+    return FALSE;
+#else
   term = fdserial_open(rxpin, txpin, 0, baud);
+#endif
 
   //dbgterm = serial_open(31,30,0,115200);
 
@@ -666,6 +1943,8 @@ int genieBegin (int rxpin, int txpin, int rstpin, int rstTime, int baud)
   //writeStr(dbgterm, (char *) "Starting...\n");
 
   mstime_start();
+
+  _genieStats.window = 8;  // one command at a time until ACKs are seen
   
   if (rstpin > 0)
   {
@@ -674,7 +1953,7 @@ int genieBegin (int rxpin, int txpin, int rstpin, int rstTime, int baud)
     pause(rstTime);
     high(rstpin);
   }
-  return true;
+  return genieWaitReady(BOOT_TIMEOUT_PERIOD) == ERROR_NONE;
 }  
 
 int genieBegin (int rxpin, int txpin, int rstpin, int baud) 
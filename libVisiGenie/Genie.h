@@ -3,22 +3,17 @@
 
 #include "fdserial.h"
 #include "simpletext.h"
+#include "GenieFrame.h"
 
-// Genie commands & replys:
-
-#define GENIE_ACK               0x06
-#define GENIE_NAK               0x15
+// Define GENIE_COG_DRIVER when building the library to talk to the 
+// display through the single cog driver in genie_uart.cogc rather
+// than through fdserial. The cog driver has not yet been verified
+// on hardware, fdserial remains the default.
 
 #define TIMEOUT_PERIOD          500
 #define RESYNC_PERIOD           100
-
-#define GENIE_READ_OBJ          0
-#define GENIE_WRITE_OBJ         1
-#define GENIE_WRITE_STR         2
-#define GENIE_WRITE_STRU        3
-#define GENIE_WRITE_CONTRAST    4
-#define GENIE_REPORT_OBJ        5
-#define GENIE_REPORT_EVENT      7
+#define BOOT_TIMEOUT_PERIOD     5000  // longest a display may take to boot
+#define PROBE_PERIOD            50    // time between probes while it boots
 
 // Objects
 //  the manual says:
@@ -62,8 +57,6 @@
 
 // Structure to store replys returned from a display
 
-#define GENIE_FRAME_SIZE        6
-
 struct genieFrameReportObj
 {
   int   cmd;
@@ -103,6 +96,126 @@ struct genieEventQueueStruct
   int         n_events;
 };
 
+/////////////////////////////////////////////////////////////////////
+// Event broadcast
+//
+// Every GENIE_REPORT_EVENT is also written to a ring that any 
+// number of subscribers, up to MAX_GENIE_SUBSCRIBERS, can read 
+// from other cogs. Each has its own read position, so reading does
+// not remove the event for the others, and a subscriber that falls
+// more than MAX_GENIE_BROADCAST events behind loses the oldest
+// ones without holding anyone else up.
+//
+#define MAX_GENIE_BROADCAST     32  // MUST be a power of 2
+#define MAX_GENIE_SUBSCRIBERS   4
+#define GENIE_SUBSCRIBE_ALL     -1  // object filter that passes every event
+
+struct genieSubscriberStruct
+{
+  int           in_use;
+  int           object;     // object type to pass, or GENIE_SUBSCRIBE_ALL
+  unsigned int  rd_seq;     // sequence number of the next event to read
+  int           overruns;   // events lost by falling too far behind
+};
+
+/////////////////////////////////////////////////////////////////////
+// Outbound rate control
+//
+// Up to GENIE_MAX_WINDOW commands may be sent before their ACKs
+// arrive. The window grows by one command per window's worth of
+// ACKs and halves on every NAK or timeout. Round trip times are
+// kept per command type, indexed by the command code.
+//
+#define GENIE_MAX_WINDOW        4   // MUST be a power of 2
+#define GENIE_CMD_TYPES         5   // GENIE_READ_OBJ..GENIE_WRITE_CONTRAST
+
+struct genieCmdStatsStruct
+{
+  int   srtt;       // smoothed round trip time, mS * 8
+  int   rttvar;     // round trip time variation, mS * 4
+  int   replies;    // ACKs (or report frames for GENIE_READ_OBJ)
+  int   naks;
+};
+
+struct genieStatsStruct
+{
+  genieCmdStatsStruct cmd[GENIE_CMD_TYPES];
+  int   window;     // commands allowed in flight * 8
+  int   timeouts;
+  int   boot_time;  // mS from reset to the display's first reply
+};
+
+/////////////////////////////////////////////////////////////////////
+// Display state snapshot
+//
+// The last value written to each object and string is remembered
+// so the whole display can be put back after a reset with 
+// genieSnapshotRestore(). It can also be kept in the EEPROM above
+// the program image to survive a reboot of the Propeller itself.
+//
+// !! The boot EEPROM's first 32K hold the program image. On a 32K 
+// !! EEPROM (24LC256) an address past the end wraps round to 0 and
+// !! a save would overwrite the program. Build the library with
+// !! GENIE_EE_SIZE set to the EEPROM's real size; genieSnapshotSave()
+// !! refuses to write below 32K or past GENIE_EE_SIZE, so with a 32K
+// !! EEPROM snapshots are simply never saved.
+//
+#define GENIE_SNAPSHOT_OBJS     32
+#define GENIE_SNAPSHOT_STRS     8
+#define GENIE_SNAPSHOT_STRLEN   32      // including the terminator
+#define GENIE_SNAPSHOT_MAGIC    0x47534E31
+
+#define GENIE_EE_IMAGE_SIZE     32768   // bytes taken by the boot image
+
+#ifndef GENIE_EE_SIZE
+#define GENIE_EE_SIZE           65536   // build option, bytes of EEPROM
+#endif
+
+#ifndef GENIE_SNAPSHOT_EE_ADDR
+#define GENIE_SNAPSHOT_EE_ADDR  GENIE_EE_IMAGE_SIZE // build option
+#endif
+
+struct genieSnapshotObj
+{
+  unsigned char   object;
+  unsigned char   index;
+  unsigned char   has_default;
+  unsigned short  value;
+  unsigned short  dflt;
+};
+
+struct genieSnapshotStruct
+{
+  int               magic;
+  int               form;       // -1 if no form has been written
+  int               contrast;   // -1 if contrast has not been written
+  int               n_objs;
+  int               n_strs;
+  genieSnapshotObj  objs[GENIE_SNAPSHOT_OBJS];
+  unsigned char     str_index[GENIE_SNAPSHOT_STRS];
+  char              strs[GENIE_SNAPSHOT_STRS][GENIE_SNAPSHOT_STRLEN];
+};
+
+/////////////////////////////////////////////////////////////////////
+// Batched writes
+//
+// Writes queued between genieBatchBegin() and genieBatchCommit()
+// are sent back to back and each one's ACK, NAK or timeout is 
+// recorded in its entry. Strings are not copied, they must stay
+// valid until the commit returns.
+//
+#define MAX_GENIE_BATCH         32
+
+struct genieBatchEntry
+{
+  int   cmd;        // GENIE_WRITE_OBJ, _STR, _STRU or _CONTRAST
+  int   object;
+  int   index;
+  int   data;
+  char  *string;
+  int   result;     // ERROR_NONE, ERROR_NAK or ERROR_TIMEOUT
+};
+
 typedef void  (*geniePutCharFuncPtr)      (int c, int baud);
 typedef int   (*genieGetCharFuncPtr)      (void);
 typedef void  (*genieUserEventHandlerPtr) (void);
@@ -112,16 +225,40 @@ typedef void  (*genieUserEventHandlerPtr) (void);
 // These function prototypes are the user API to the library
 //
 extern int    genieBegin                (int rxpin, int txpin, int rstpin, int baud);
+extern int    genieWaitReady            (int deadline);
 extern bool   genieReadObject           (int object, int index);
 extern int    genieWriteObject          (int object, int index, int data);
 extern void   genieWriteContrast        (int value);
 extern int    genieWriteStr             (int index, char *string);
 extern int    genieWriteStrU            (int index, char *string);
+extern void   genieBatchBegin           (void);
+extern int    genieBatchWriteObject     (int object, int index, int data);
+extern int    genieBatchWriteContrast   (int value);
+extern int    genieBatchWriteStr        (int index, char *string);
+extern int    genieBatchWriteStrU       (int index, char *string);
+extern int    genieBatchCommit          (int retries);
+extern int    genieBatchResult          (int entry);
+extern int    genieWriteInt             (int index, int value, int width, int flags, char *units);
+extern int    genieWriteFixed           (int index, int value, int decimals, int width, int flags, char *units);
 extern bool   genieEventIs              (genieFrame * e, int cmd, int object, int index);
 extern int    genieGetEventData         (genieFrame * e); 
 extern int    genieDoEvents             (void);
 extern void   genieAttachEventHandler   (genieUserEventHandlerPtr userHandler);
 extern bool   genieDequeueEvent         (genieFrame * buff);
+extern int    genieSubscribe            (int object);
+extern void   genieUnsubscribe          (int id);
+extern bool   genieSubscriberDequeue    (int id, genieFrame * buff);
+extern int    genieSubscriberOverruns   (int id);
+extern void   genieGetStats             (genieStatsStruct * stats);
+extern void   genieSnapshotClear        (void);
+extern void   genieSnapshotDefault      (int object, int index, int data);
+extern int    genieSnapshotRestore      (void);
+extern int    genieSnapshotSave         (void);
+extern int    genieSnapshotLoad         (void);
+
+// Flags for genieWriteInt() and genieWriteFixed()
+#define GENIE_FMT_ZEROPAD       1   // pad to width with '0' rather than ' '
+#define GENIE_FMT_PLUS          2   // show '+' on positive values
 
 #ifndef TRUE
 #define TRUE  (1==1)
@@ -137,6 +274,8 @@ extern bool   genieDequeueEvent         (genieFrame * buff);
 #define ERROR_RESYNC            -6  // 250  0xFA
 #define ERROR_NODISPLAY         -7  // 249  0xF9
 #define ERROR_BAD_CS            -8  // 248  0xF8
+#define ERROR_NOSNAPSHOT        -9  // 247  0xF7
+#define ERROR_NOENTRY           -10 // 246  0xF6
 
 #define GENIE_LINK_IDLE         0
 #define GENIE_LINK_WFAN         1 // waiting for Ack or Nak
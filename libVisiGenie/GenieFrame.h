@@ -0,0 +1,120 @@
+#ifndef GENIE_FRAME_H
+#define GENIE_FRAME_H
+
+/////////////////////////////////////////////////////////////////////
+// The Genie wire protocol and frame assembler
+//
+// Shared by the library (Genie.c) and the single cog UART driver
+// (genie_uart.cogc), so it must stay plain C that builds for both
+// the CMM and the COG memory models: no library calls and no
+// state other than what the caller passes in. It also builds on a
+// host, test/genie_frame_test.c exercises genieFramerByte().
+//
+// The cog driver has only been run in a host simulation, it has
+// not yet been verified against a display on real hardware.
+//
+
+// Genie commands & replys:
+
+#define GENIE_ACK               0x06
+#define GENIE_NAK               0x15
+
+#define GENIE_READ_OBJ          0
+#define GENIE_WRITE_OBJ         1
+#define GENIE_WRITE_STR         2
+#define GENIE_WRITE_STRU        3
+#define GENIE_WRITE_CONTRAST    4
+#define GENIE_REPORT_OBJ        5
+#define GENIE_REPORT_EVENT      7
+
+#define GENIE_FRAME_SIZE        6
+
+/////////////////////////////////////////////////////////////////////
+// Frame assembler state. Each receive path owns one, genieDoEvents()
+// and the cog driver (as a local, so it stays in cog registers).
+// The bytes themselves go to a frame buffer passed with each one.
+//
+typedef struct
+{
+  int   count;      // bytes of the frame received so far
+  int   checksum;   // XOR of those bytes
+} genieFramerStruct;
+
+#define GENIE_FRAME_MORE        0   // more bytes needed
+#define GENIE_FRAME_DONE        1   // frame holds a good frame
+#define GENIE_FRAME_BAD_CS      2   // frame complete, checksum bad
+#define GENIE_FRAME_REPLY       3   // frame[0] holds an ACK or NAK
+
+////////////////////////// genieFramerByte //////////////////////////
+//
+// Accumulate one byte of a report or event frame and check the
+// checksum once GENIE_FRAME_SIZE bytes have arrived. The framer
+// is ready for the next frame after GENIE_FRAME_DONE or
+// GENIE_FRAME_BAD_CS, or once count is set back to 0.
+//
+// Between frames only GENIE_REPORT_OBJ or GENIE_REPORT_EVENT start
+// one. An ACK or NAK is returned on its own and anything else is
+// dropped, so after a lost byte the framer finds its way back to
+// the start of a later frame.
+//
+// Parms:  genieFramerStruct * f, the caller's framer
+//      volatile int * frame, GENIE_FRAME_SIZE ints for the bytes
+//      int c, the received byte
+//
+// Returns:  GENIE_FRAME_MORE, GENIE_FRAME_DONE, GENIE_FRAME_BAD_CS
+//        or GENIE_FRAME_REPLY
+//
+static inline int genieFramerByte (genieFramerStruct * f, volatile int * frame, int c)
+{
+  if (f->count == 0 && c != GENIE_REPORT_OBJ && c != GENIE_REPORT_EVENT) {
+    if (c == GENIE_ACK || c == GENIE_NAK) {
+      frame[0] = c;
+      return GENIE_FRAME_REPLY;
+    }
+    return GENIE_FRAME_MORE;
+  }
+
+  f->checksum = (f->count == 0) ? c : f->checksum ^ c;
+  frame[f->count++] = c;
+
+  if (f->count < GENIE_FRAME_SIZE)
+    return GENIE_FRAME_MORE;
+
+  f->count = 0;
+  return (f->checksum == 0) ? GENIE_FRAME_DONE : GENIE_FRAME_BAD_CS;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Mailbox shared with the cog driver
+//
+// tx_buf carries bytes to the display, the library moves tx_head
+// and the cog moves tx_tail. rx_buf carries complete, checked
+// frames from the display, the cog moves rx_head and the library
+// moves rx_tail. An ACK or NAK arrives as an entry whose first
+// int is GENIE_ACK or GENIE_NAK. The cog assembles each frame in
+// place in rx_buf[rx_head] and only moves rx_head on to publish 
+// it once the checksum is good.
+//
+// The library sets rx_reset to make the cog drop any frame it is
+// part way through, the cog clears it once it has.
+//
+#define GENIE_COG_TXBUF         64  // bytes, MUST be a power of 2
+#define GENIE_COG_RXBUF         16  // frames, MUST be a power of 2
+
+typedef struct
+{
+  int                     rxpin;
+  int                     txpin;
+  int                     bit_ticks;  // system clocks per bit
+  volatile int            tx_head;
+  volatile int            tx_tail;
+  volatile unsigned char  tx_buf[GENIE_COG_TXBUF];
+  volatile int            rx_head;
+  volatile int            rx_tail;
+  volatile int            rx_buf[GENIE_COG_RXBUF][GENIE_FRAME_SIZE];
+  volatile int            rx_overruns;  // frames lost with rx_buf full
+  volatile int            rx_bad_cs;    // frames dropped for a bad checksum
+  volatile int            rx_reset;     // set by the library, see above
+} genieCogMailbox;
+
+#endif
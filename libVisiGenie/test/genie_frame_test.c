@@ -0,0 +1,140 @@
+#include <stdio.h>
+
+#include "../GenieFrame.h"
+
+/////////////////////////// genie_frame_test.c /////////////////////////
+//
+//      Host test of the frame assembler shared by the library and
+//      the cog driver. Build and run it on a PC, from this directory:
+//
+//        cc -o genie_frame_test genie_frame_test.c && ./genie_frame_test
+//
+//      Prints each failed check and exits with 1 if there were any.
+//
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: FAILED %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+///////////////////////////// feed ///////////////////////////////
+//
+// Pass bytes to the framer, as the cog does, counting the results.
+//
+// Returns:  The result for the last byte
+//
+static int feed (genieFramerStruct *f, int *frame, const int *bytes, int n, int *counts)
+{
+  int result = GENIE_FRAME_MORE;
+
+  for (int i = 0; i < n; i++) {
+    result = genieFramerByte(f, frame, bytes[i]);
+    counts[result]++;
+  }
+  return result;
+}
+
+static void testGoodFrame (void)
+{
+  genieFramerStruct f = {0, 0};
+  int frame[GENIE_FRAME_SIZE] = {0};
+  int counts[4] = {0};
+  const int bytes[] = {GENIE_REPORT_EVENT, 4, 0, 0, 5, GENIE_REPORT_EVENT ^ 4 ^ 5};
+
+  CHECK(feed(&f, frame, bytes, 6, counts) == GENIE_FRAME_DONE);
+  CHECK(counts[GENIE_FRAME_MORE] == 5);
+  for (int j = 0; j < GENIE_FRAME_SIZE; j++) {
+    CHECK(frame[j] == bytes[j]);
+  }
+  CHECK(f.count == 0);
+}
+
+static void testBadChecksum (void)
+{
+  genieFramerStruct f = {0, 0};
+  int frame[GENIE_FRAME_SIZE];
+  int counts[4] = {0};
+  const int bytes[] = {GENIE_REPORT_OBJ, 10, 0, 0, 1, 0x55};
+
+  CHECK(feed(&f, frame, bytes, 6, counts) == GENIE_FRAME_BAD_CS);
+  CHECK(counts[GENIE_FRAME_DONE] == 0);
+  CHECK(f.count == 0);
+}
+
+static void testRepliesBetweenFrames (void)
+{
+  genieFramerStruct f = {0, 0};
+  int frame[GENIE_FRAME_SIZE];
+  int counts[4] = {0};
+
+  CHECK(genieFramerByte(&f, frame, GENIE_ACK) == GENIE_FRAME_REPLY);
+  CHECK(frame[0] == GENIE_ACK);
+  CHECK(genieFramerByte(&f, frame, GENIE_NAK) == GENIE_FRAME_REPLY);
+  CHECK(frame[0] == GENIE_NAK);
+
+  // stray bytes between frames are dropped
+  CHECK(genieFramerByte(&f, frame, 0x33) == GENIE_FRAME_MORE);
+  CHECK(f.count == 0);
+
+  // an ACK valued byte inside a frame is data, not a reply
+  const int bytes[] = {GENIE_REPORT_EVENT, GENIE_ACK, 0, 0, 0, GENIE_REPORT_EVENT ^ GENIE_ACK};
+  CHECK(feed(&f, frame, bytes, 6, counts) == GENIE_FRAME_DONE);
+  CHECK(counts[GENIE_FRAME_REPLY] == 0);
+  CHECK(frame[1] == GENIE_ACK);
+}
+
+static void testDroppedByte (void)
+{
+  genieFramerStruct f = {0, 0};
+  int frame[GENIE_FRAME_SIZE];
+  int counts[4] = {0};
+
+  // the first frame loses a byte, so it takes the first byte of the
+  // second frame, the rest of that is dropped and the third frame
+  // comes through whole
+  const int bytes[] = {
+    GENIE_REPORT_EVENT, 4, 0, 5, GENIE_REPORT_EVENT ^ 4 ^ 5,
+    GENIE_REPORT_EVENT, 30, 1, 0, 1, GENIE_REPORT_EVENT ^ 30 ^ 1 ^ 1,
+    GENIE_REPORT_EVENT, 4, 0, 0, 9, GENIE_REPORT_EVENT ^ 4 ^ 9
+  };
+
+  CHECK(feed(&f, frame, bytes, sizeof(bytes) / sizeof(bytes[0]), counts) == GENIE_FRAME_DONE);
+  CHECK(counts[GENIE_FRAME_BAD_CS] == 1);
+  CHECK(counts[GENIE_FRAME_DONE] == 1);
+  CHECK(frame[4] == 9);
+}
+
+static void testReset (void)
+{
+  genieFramerStruct f = {0, 0};
+  int frame[GENIE_FRAME_SIZE];
+  int counts[4] = {0};
+  const int part[] = {GENIE_REPORT_EVENT, 4, 0};
+
+  // setting count back to 0, as the cog does for rx_reset, means
+  // the next reply is not swallowed into the part frame
+  feed(&f, frame, part, 3, counts);
+  f.count = 0;
+  CHECK(genieFramerByte(&f, frame, GENIE_ACK) == GENIE_FRAME_REPLY);
+}
+
+int main (void)
+{
+  testGoodFrame();
+  testBadChecksum();
+  testRepliesBetweenFrames();
+  testDroppedByte();
+  testReset();
+
+  if (failures > 0) {
+    printf("%d checks FAILED\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}